@@ -182,14 +182,15 @@ int32_t on_response(const uint8_t* data, uint32_t size)
 
 ssize_t send_request(int fd, const std::vector<std::string>& cmd)
 {
-    uint32_t len = 4;
+    size_t len = 4;
     for (const auto& s : cmd)
     {
         len += 4 + s.size();
     }
-    if (len > MAX_MSG) { return -1; }
-    char wbuf[4 + MAX_MSG];
-    memcpy(&wbuf[0], &len, 4);
+    if (len > DEFAULT_MAX_REQUEST) { return -1; }
+    std::string wbuf(4 + len, '\0');
+    uint32_t wlen = static_cast<uint32_t>(len);
+    memcpy(&wbuf[0], &wlen, 4);
     uint32_t n = static_cast<uint32_t>(cmd.size());
     memcpy(&wbuf[4], &n, 4);
 
@@ -201,15 +202,15 @@ ssize_t send_request(int fd, const std::vector<std::string>& cmd)
         memcpy(&wbuf[cur + 4], s.c_str(), s.size());
         cur += 4 + s.size();
     }
-    return write_all(fd, wbuf, 4 + len);
+    return write_all(fd, wbuf.data(), wbuf.size());
 }
 
 ssize_t recv_request(int fd)
 {
-    char rbuf[4 + MAX_MSG + 1];
+    char hbuf[4];
 
     errno = 0;
-    ssize_t ret = read_full(fd, rbuf, 4);
+    ssize_t ret = read_full(fd, hbuf, 4);
     if (ret < 0)
     {
         fprintf(stderr, "%s.\n", errno == 0 ? "read() EOF" : "read() error");
@@ -217,20 +218,21 @@ ssize_t recv_request(int fd)
     }
 
     uint32_t len = 0;
-    memcpy(&len, rbuf, 4);
-    if (len > MAX_MSG)
+    memcpy(&len, hbuf, 4);
+    if (len > MAX_RESPONSE)
     {
         fprintf(stderr, "command is too long.\n");
         return -1;
     }
-    ret = read_full(fd, &rbuf[4], len);
+    std::vector<char> rbuf(len + 1);
+    ret = read_full(fd, rbuf.data(), len);
     if (ret < 0)
     {
         fprintf(stderr, "read() error.\n");
         return ret;
     }
 
-    int32_t rv = on_response(reinterpret_cast<uint8_t*>(&rbuf[4]), len);
+    int32_t rv = on_response(reinterpret_cast<uint8_t*>(rbuf.data()), len);
     if (rv > 0 && static_cast<uint32_t>(rv) != len)
     {
         fprintf(stderr, "bad response.\n");
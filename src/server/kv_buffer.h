@@ -0,0 +1,85 @@
+#ifndef KV_BUFFER_H
+#define KV_BUFFER_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include "../utils/kv_constant.h"
+
+/*
+ * Per-thread pool of connection buffers binned by power-of-two capacity.
+ * Connections take a buffer only while they have bytes in flight and hand
+ * it back once it drains, so idle connections hold no buffer memory.
+ */
+class BufferPool
+{
+public:
+    static BufferPool& Local()
+    {
+        thread_local BufferPool pool;
+        return pool;
+    }
+
+    std::string acquire(size_t min_size)
+    {
+        size_t cls = class_of(min_size);
+        for (size_t c = cls; c < POOL_CLASSES; ++c)
+        {
+            if (!free_bufs[c].empty())
+            {
+                std::string buf = std::move(free_bufs[c].back());
+                free_bufs[c].pop_back();
+                pooled_bytes -= buf.capacity();
+                return buf;
+            }
+        }
+        std::string buf;
+        buf.reserve(cls < POOL_CLASSES ? BUF_MIN_SIZE << cls : min_size);
+        return buf;
+    }
+
+    void release(std::string& buf)
+    {
+        size_t cap = buf.capacity();
+        if (cap >= BUF_MIN_SIZE)
+        {
+            size_t cls = floor_class_of(cap);
+            if (cls < POOL_CLASSES && free_bufs[cls].size() < POOL_MAX_FREE)
+            {
+                pooled_bytes += cap;
+                free_bufs[cls].push_back(std::move(buf));
+            }
+        }
+        std::string().swap(buf);
+    }
+
+    size_t memory_usage() const { return pooled_bytes; }
+
+private:
+    static constexpr size_t POOL_CLASSES = 9;
+    static constexpr size_t POOL_MAX_FREE = 64;
+
+    std::vector<std::string> free_bufs[POOL_CLASSES];
+    size_t pooled_bytes = 0;
+
+    static size_t class_of(size_t size)
+    {
+        size_t cls = 0;
+        while ((BUF_MIN_SIZE << cls) < size) { ++cls; }
+        return cls;
+    }
+
+    static size_t floor_class_of(size_t cap)
+    {
+        size_t cls = 0;
+        while ((BUF_MIN_SIZE << (cls + 1)) <= cap) { ++cls; }
+        return cls;
+    }
+
+    BufferPool() {}
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef KV_COMMAND_H
+#define KV_COMMAND_H
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+class CmdArgs;
+
+constexpr size_t CMD_INDEX_SLOTS = 64;
+
+constexpr uint32_t CMD_READONLY = 1u << 0;
+constexpr uint32_t CMD_WRITE = 1u << 1;
+constexpr uint32_t CMD_ADMIN = 1u << 2;
+// The second word must be the "str" type tag, as in "get str key".
+constexpr uint32_t CMD_STR_TYPE = 1u << 3;
+
+/*
+ * One row of the command table. A positive arity is the exact number of
+ * words including the command name, a negative arity is the minimum.
+ */
+struct KvCommand
+{
+    const char* name;
+    int arity;
+    uint32_t flags;
+    void (*handler)(const CmdArgs& cmd, std::string& out);
+};
+
+constexpr size_t cmd_name_len(const char* s)
+{
+    size_t n = 0;
+    while (s[n] != '\0') { ++n; }
+    return n;
+}
+
+// FNV-1a over the name with ASCII letters folded to lower case.
+constexpr uint32_t cmd_hash(const char* s, size_t n, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < n; ++i) { h = (h ^ static_cast<uint8_t>(s[i] | 0x20)) * 16777619u; }
+    return h ^ (h >> 15);
+}
+
+/*
+ * Collision-free slot map from a command name to its row in the table,
+ * built at compile time by searching for a hash seed under which every
+ * name lands in its own slot. slot[] holds the row index plus one.
+ */
+template <size_t SLOTS>
+struct CommandIndex
+{
+    static constexpr uint32_t NO_SEED = ~0u;
+
+    uint32_t seed = NO_SEED;
+    uint16_t slot[SLOTS] = {};
+
+    size_t lookup(std::string_view name) const
+    {
+        return slot[cmd_hash(name.data(), name.size(), seed) & (SLOTS - 1)];
+    }
+};
+
+template <size_t SLOTS, size_t N>
+constexpr CommandIndex<SLOTS> build_command_index(const KvCommand (&table)[N])
+{
+    static_assert((SLOTS & (SLOTS - 1)) == 0 && SLOTS >= N, "slot count must be a power of two above the command count");
+    for (uint32_t seed = 0; seed < 4096; ++seed)
+    {
+        CommandIndex<SLOTS> idx;
+        bool collision = false;
+        for (size_t i = 0; i < N && !collision; ++i)
+        {
+            size_t s = cmd_hash(table[i].name, cmd_name_len(table[i].name), seed) & (SLOTS - 1);
+            collision = idx.slot[s] != 0;
+            idx.slot[s] = static_cast<uint16_t>(i + 1);
+        }
+        if (!collision)
+        {
+            idx.seed = seed;
+            return idx;
+        }
+    }
+    return CommandIndex<SLOTS>();
+}
+
+#endif
@@ -0,0 +1,377 @@
+#ifndef KV_DICT_H
+#define KV_DICT_H
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <cstdint>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Open-addressing hash table in the style of Swiss tables: each slot has a one
+ * byte control word (empty, deleted, or the low 7 bits of the hash), slots are
+ * probed 16 at a time with SSE2 and groups are visited linearly.
+ *
+ * Growth never rehashes the whole table at once. A second table is allocated
+ * and every insert/erase moves a bounded number of groups into it, always
+ * finishing the probe cluster it started so lookups in the old table stay
+ * correct. Lookups never mutate the table and are safe under a shared lock.
+ */
+class CtrlGroup
+{
+public:
+    static constexpr size_t WIDTH = 16;
+    static constexpr int8_t EMPTY = -128;
+    static constexpr int8_t DELETED = -2;
+
+    explicit CtrlGroup(const int8_t* pos)
+    {
+#if defined(__SSE2__)
+        ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+#else
+        memcpy(ctrl, pos, WIDTH);
+#endif
+    }
+
+    uint32_t match(int8_t h2) const
+    {
+#if defined(__SSE2__)
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl)));
+#else
+        return match_byte([h2](int8_t c) { return c == h2; });
+#endif
+    }
+
+    uint32_t match_empty() const
+    {
+#if defined(__SSE2__)
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(EMPTY), ctrl)));
+#else
+        return match_byte([](int8_t c) { return c == EMPTY; });
+#endif
+    }
+
+    uint32_t match_empty_or_deleted() const
+    {
+#if defined(__SSE2__)
+        return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+#else
+        return match_byte([](int8_t c) { return c < 0; });
+#endif
+    }
+
+    uint32_t match_full() const { return ~match_empty_or_deleted() & 0xFFFF; }
+
+private:
+#if defined(__SSE2__)
+    __m128i ctrl;
+#else
+    int8_t ctrl[WIDTH];
+
+    template <typename Pred>
+    uint32_t match_byte(Pred pred) const
+    {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < WIDTH; ++i)
+        {
+            if (pred(ctrl[i])) { mask |= 1u << i; }
+        }
+        return mask;
+    }
+#endif
+};
+
+template <typename V>
+class KvDict
+{
+public:
+    struct Entry
+    {
+        std::string key;
+        V val;
+    };
+
+    static constexpr size_t MIN_GROUPS = 1;
+    static constexpr size_t REHASH_GROUPS = 1;
+
+    KvDict() {}
+
+    ~KvDict()
+    {
+        free_table(ht[0]);
+        free_table(ht[1]);
+    }
+
+    size_t size() const { return ht[0].used + ht[1].used; }
+
+    bool rehashing() const { return ht[1].ctrl != nullptr; }
+
+    size_t memory_usage() const { return table_bytes(ht[0]) + table_bytes(ht[1]); }
+
+    size_t rehash_moved_groups() const { return rehashing() ? rehash_done : 0; }
+
+    size_t rehash_total_groups() const { return rehashing() ? ht[0].group_mask + 1 : 0; }
+
+    static size_t hash_key(std::string_view key) { return std::hash<std::string_view>{}(key); }
+
+    V* find(std::string_view key)
+    {
+        Entry* e = find_entry(key, hash_key(key));
+        return e ? &e->val : nullptr;
+    }
+
+    const V* find(std::string_view key) const { return const_cast<KvDict*>(this)->find(key); }
+
+    std::pair<V*, bool> try_emplace(std::string_view key)
+    {
+        rehash_step(REHASH_GROUPS);
+        size_t h = hash_key(key);
+        Entry* e = find_entry(key, h);
+        if (e) { return { &e->val, false }; }
+        Table& t = reserve_one();
+        e = insert_new(t, h, std::string(key), V());
+        return { &e->val, true };
+    }
+
+    template <typename T>
+    bool insert_or_assign(std::string_view key, T&& val)
+    {
+        auto res = try_emplace(key);
+        *res.first = std::forward<T>(val);
+        return res.second;
+    }
+
+    bool erase(std::string_view key)
+    {
+        rehash_step(REHASH_GROUPS);
+        size_t h = hash_key(key);
+        for (Table& t : ht)
+        {
+            size_t idx = find_index(t, key, h);
+            if (idx != NPOS)
+            {
+                erase_at(t, idx);
+                maybe_shrink();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename F>
+    void for_each(F&& f)
+    {
+        for (Table& t : ht)
+        {
+            for (size_t g = 0; t.ctrl && g <= t.group_mask; ++g)
+            {
+                for (uint32_t m = CtrlGroup(t.ctrl + g * CtrlGroup::WIDTH).match_full(); m; m &= m - 1)
+                {
+                    Entry& e = t.slots[g * CtrlGroup::WIDTH + __builtin_ctz(m)];
+                    f(static_cast<const std::string&>(e.key), e.val);
+                }
+            }
+        }
+    }
+
+    bool rehash_step(size_t groups)
+    {
+        if (!rehashing()) { return false; }
+        Table& from = ht[0];
+        size_t total = from.group_mask + 1;
+        while (rehash_done < total)
+        {
+            size_t g = rehash_pos;
+            int8_t* ctrl = from.ctrl + g * CtrlGroup::WIDTH;
+            bool cluster_end = CtrlGroup(ctrl).match_empty() != 0;
+            for (uint32_t m = CtrlGroup(ctrl).match_full(); m; m &= m - 1)
+            {
+                Entry& e = from.slots[g * CtrlGroup::WIDTH + __builtin_ctz(m)];
+                insert_new(ht[1], hash_key(e.key), std::move(e.key), std::move(e.val));
+                e.~Entry();
+                --from.used;
+            }
+            memset(ctrl, CtrlGroup::EMPTY, CtrlGroup::WIDTH);
+            rehash_pos = (g + 1) & from.group_mask;
+            ++rehash_done;
+            if (cluster_end && --groups == 0) { break; }
+        }
+        if (rehash_done == total)
+        {
+            free_table(ht[0]);
+            ht[0] = ht[1];
+            ht[1] = Table();
+        }
+        return rehashing();
+    }
+
+private:
+    static constexpr size_t NPOS = ~size_t(0);
+
+    struct Table
+    {
+        int8_t* ctrl = nullptr;
+        Entry* slots = nullptr;
+        size_t group_mask = 0;
+        size_t used = 0;
+        size_t growth_left = 0;
+
+        size_t capacity() const { return ctrl ? (group_mask + 1) * CtrlGroup::WIDTH : 0; }
+    };
+
+    Table ht[2];
+    size_t rehash_pos = 0;
+    size_t rehash_done = 0;
+
+    static int8_t h2_of(size_t h) { return static_cast<int8_t>(h & 0x7F); }
+
+    static size_t table_bytes(const Table& t) { return t.capacity() * (sizeof(int8_t) + sizeof(Entry)); }
+
+    static size_t groups_for(size_t entries)
+    {
+        size_t groups = MIN_GROUPS;
+        while (groups * CtrlGroup::WIDTH * 7 / 8 < entries) { groups <<= 1; }
+        return groups;
+    }
+
+    static void alloc_table(Table& t, size_t groups)
+    {
+        size_t cap = groups * CtrlGroup::WIDTH;
+        t.ctrl = new int8_t[cap];
+        memset(t.ctrl, CtrlGroup::EMPTY, cap);
+        t.slots = static_cast<Entry*>(::operator new(sizeof(Entry) * cap));
+        t.group_mask = groups - 1;
+        t.used = 0;
+        t.growth_left = cap * 7 / 8;
+    }
+
+    static void free_table(Table& t)
+    {
+        if (!t.ctrl) { return; }
+        for (size_t g = 0; t.used && g <= t.group_mask; ++g)
+        {
+            for (uint32_t m = CtrlGroup(t.ctrl + g * CtrlGroup::WIDTH).match_full(); m; m &= m - 1)
+            {
+                t.slots[g * CtrlGroup::WIDTH + __builtin_ctz(m)].~Entry();
+            }
+        }
+        delete[] t.ctrl;
+        ::operator delete(t.slots);
+        t = Table();
+    }
+
+    static size_t find_index(const Table& t, std::string_view key, size_t h)
+    {
+        if (!t.ctrl) { return NPOS; }
+        size_t g = (h >> 7) & t.group_mask;
+        for (size_t n = 0; n <= t.group_mask; ++n)
+        {
+            CtrlGroup grp(t.ctrl + g * CtrlGroup::WIDTH);
+            for (uint32_t m = grp.match(h2_of(h)); m; m &= m - 1)
+            {
+                size_t idx = g * CtrlGroup::WIDTH + __builtin_ctz(m);
+                if (t.slots[idx].key == key) { return idx; }
+            }
+            if (grp.match_empty()) { return NPOS; }
+            g = (g + 1) & t.group_mask;
+        }
+        return NPOS;
+    }
+
+    Entry* find_entry(std::string_view key, size_t h)
+    {
+        for (Table& t : ht)
+        {
+            size_t idx = find_index(t, key, h);
+            if (idx != NPOS) { return &t.slots[idx]; }
+        }
+        return nullptr;
+    }
+
+    static Entry* insert_new(Table& t, size_t h, std::string&& key, V&& val)
+    {
+        size_t g = (h >> 7) & t.group_mask;
+        while (true)
+        {
+            uint32_t m = CtrlGroup(t.ctrl + g * CtrlGroup::WIDTH).match_empty_or_deleted();
+            if (m)
+            {
+                size_t idx = g * CtrlGroup::WIDTH + __builtin_ctz(m);
+                if (t.ctrl[idx] == CtrlGroup::EMPTY) { --t.growth_left; }
+                t.ctrl[idx] = h2_of(h);
+                ++t.used;
+                return new (&t.slots[idx]) Entry{ std::move(key), std::move(val) };
+            }
+            g = (g + 1) & t.group_mask;
+        }
+    }
+
+    void erase_at(Table& t, size_t idx)
+    {
+        t.slots[idx].~Entry();
+        --t.used;
+        if (CtrlGroup(t.ctrl + (idx / CtrlGroup::WIDTH) * CtrlGroup::WIDTH).match_empty())
+        {
+            t.ctrl[idx] = CtrlGroup::EMPTY;
+            ++t.growth_left;
+        }
+        else
+        {
+            t.ctrl[idx] = CtrlGroup::DELETED;
+        }
+    }
+
+    void start_rehash(size_t groups)
+    {
+        alloc_table(ht[1], groups);
+        size_t total = ht[0].group_mask + 1;
+        rehash_pos = 0;
+        rehash_done = 0;
+        for (size_t g = 0; g < total; ++g)
+        {
+            if (CtrlGroup(ht[0].ctrl + g * CtrlGroup::WIDTH).match_empty())
+            {
+                rehash_pos = (g + 1) & ht[0].group_mask;
+                break;
+            }
+        }
+    }
+
+    // The new table must absorb every migrated entry plus one insert per
+    // remaining old group, since each insert migrates at least one group.
+    size_t target_groups() const
+    {
+        size_t used = ht[0].used;
+        return groups_for(std::max(used * 2, used + ht[0].group_mask + 1));
+    }
+
+    Table& reserve_one()
+    {
+        if (!ht[0].ctrl)
+        {
+            alloc_table(ht[0], MIN_GROUPS);
+            return ht[0];
+        }
+        if (rehashing()) { return ht[1]; }
+        if (ht[0].growth_left == 0) { start_rehash(target_groups()); return ht[1]; }
+        return ht[0];
+    }
+
+    void maybe_shrink()
+    {
+        if (rehashing() || ht[0].group_mask + 1 <= MIN_GROUPS) { return; }
+        if (ht[0].used * 16 < ht[0].capacity())
+        {
+            size_t groups = target_groups();
+            if (groups <= ht[0].group_mask) { start_rehash(groups); }
+        }
+    }
+};
+
+#endif
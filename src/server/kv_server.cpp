@@ -4,48 +4,21 @@ int main(int argc, char* argv[])
 {
     std::signal(SIGINT, signal_handler);
     std::signal(SIGTERM, signal_handler);
-    int fd = Open_listenfd("1234");
-    std::vector<std::unique_ptr<ConnectionNode>> fd_to_connection;
 
-    fd_set_nb(fd);
-    int epoll_fd = Epoll_create1(EPOLL_CLOEXEC);
+    if (!parse_config(argc, argv))
+    {
+        fprintf(stderr, "usage: %s [--loops N(1-%d)] [--max-request BYTES] [--io epoll|uring]\n", argv[0], MAX_EVENT_LOOPS);
+        exit(EXIT_FAILURE);
+    }
+    int loops = ServerConfig::Instance().event_loops;
 
-    struct epoll_event ev;
-    ev.events = EPOLLIN, ev.data.fd = fd;
-    Epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
-    while (true)
+    std::vector<std::thread> reactors;
+    for (int i = 1; i < loops; ++i)
     {
-        std::vector<struct epoll_event> events(SOMAXCONN);
-        int ret = Epoll_wait(epoll_fd, events.data(), events.size(), TIMEOUT_VAL);
-        for (int i = 0; i < ret; ++i)
-        {
-            if (events[i].data.fd == fd)
-            {
-                int connfd = accept_new_connection(fd_to_connection, fd);
-                ev.events = EPOLLIN, ev.data.fd = connfd;
-                Epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connfd, &ev);
-            }
-            else
-            {
-                auto& conn = fd_to_connection[events[i].data.fd];
-                connection_io(conn);
-                if (conn->state == STATE_END)
-                {
-                    Epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
-                    close(conn->fd);
-                    fd_to_connection[conn->fd].reset(nullptr);
-                }
-                else
-                {
-                    ev.events = (conn->state == STATE_REQ ? EPOLLIN : EPOLLOUT) | EPOLLERR;
-                    ev.data.fd = conn->fd;
-                    Epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
-                }
-            }
-        }
+        reactors.emplace_back(run_event_loop, "1234");
     }
-    close(fd);
-    close(epoll_fd);
+    run_event_loop("1234");
+    for (auto& t : reactors) { t.join(); }
 
     return 0;
 }
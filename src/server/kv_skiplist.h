@@ -0,0 +1,342 @@
+#ifndef KV_SKIPLIST_H
+#define KV_SKIPLIST_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+struct SkipNode
+{
+    struct Level
+    {
+        SkipNode* forward;
+        size_t span;
+    };
+
+    int64_t score;
+    std::string member;
+    int height;
+    Level level[1];
+
+    const SkipNode* next() const { return level[0].forward; }
+
+    static size_t alloc_size(int height)
+    {
+        size_t sz = offsetof(SkipNode, level) + sizeof(Level) * height;
+        return (sz + alignof(SkipNode) - 1) & ~(alignof(SkipNode) - 1);
+    }
+};
+
+/*
+ * Slab allocator for skiplist nodes. Nodes of the same height share a size
+ * class, freed nodes go on a per-height free list and chunks are only
+ * returned to the system when the whole list is cleared.
+ */
+class SkipNodeArena
+{
+public:
+    static constexpr size_t CHUNK_BYTES = 64 * 1024;
+
+    explicit SkipNodeArena(int max_height) : free_lists(max_height + 1, nullptr) {}
+
+    ~SkipNodeArena() { release(); }
+
+    void* allocate(int height)
+    {
+        FreeSlot*& head = free_lists[height];
+        if (head)
+        {
+            FreeSlot* slot = head;
+            head = slot->next;
+            return slot;
+        }
+        size_t sz = SkipNode::alloc_size(height);
+        if (chunk_left < sz)
+        {
+            chunks.push_back(static_cast<char*>(::operator new(CHUNK_BYTES)));
+            chunk_pos = chunks.back();
+            chunk_left = CHUNK_BYTES;
+        }
+        void* p = chunk_pos;
+        chunk_pos += sz, chunk_left -= sz;
+        return p;
+    }
+
+    void deallocate(void* p, int height)
+    {
+        FreeSlot* slot = static_cast<FreeSlot*>(p);
+        slot->next = free_lists[height];
+        free_lists[height] = slot;
+    }
+
+    void release()
+    {
+        for (char* chunk : chunks) { ::operator delete(chunk); }
+        chunks.clear();
+        std::fill(free_lists.begin(), free_lists.end(), nullptr);
+        chunk_pos = nullptr, chunk_left = 0;
+    }
+
+    size_t memory_usage() const { return chunks.size() * CHUNK_BYTES; }
+
+private:
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    std::vector<char*> chunks;
+    std::vector<FreeSlot*> free_lists;
+    char* chunk_pos = nullptr;
+    size_t chunk_left = 0;
+};
+
+/*
+ * Skiplist ordered by (score, member), so members may share a score. Every
+ * forward link records how many level-0 nodes it skips, which makes rank
+ * lookups and rank/score range counts O(log n).
+ */
+class SkipList
+{
+public:
+    SkipList(int _max_level = 18) : max_level(std::min(_max_level, MAX_HEIGHT - 1)), skiplist_level(0), element_count(0), arena(max_level + 1)
+    {
+        std::random_device rd;
+        rng_state = (uint64_t(rd()) << 32) | rd();
+        header = create_node(int64_t(), std::string_view(), max_level);
+    }
+
+    ~SkipList()
+    {
+        for (SkipNode* cur = header; cur != nullptr; cur = cur->level[0].forward) { cur->member.~basic_string(); }
+    }
+
+    SkipList(const SkipList&) = delete;
+    SkipList& operator=(const SkipList&) = delete;
+
+    int get_random_level()
+    {
+        uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        int cur_level = __builtin_ctzll(z | (uint64_t(1) << 63)) / 2;
+        return std::min(cur_level, max_level);
+    }
+
+    SkipNode* create_node(int64_t _score, std::string_view _member, const int _level)
+    {
+        SkipNode* node = static_cast<SkipNode*>(arena.allocate(_level + 1));
+        node->score = _score;
+        new (&node->member) std::string(_member);
+        node->height = _level + 1;
+        for (int i = 0; i <= _level; ++i) { node->level[i] = { nullptr, 0 }; }
+        return node;
+    }
+
+    void destroy_node(SkipNode* node)
+    {
+        node->member.~basic_string();
+        arena.deallocate(node, node->height);
+    }
+
+    // The caller guarantees _member is not in the list yet.
+    void insert(int64_t _score, std::string_view _member)
+    {
+        insert_node(create_node(_score, _member, get_random_level()));
+    }
+
+    bool cancel(int64_t _score, std::string_view _member)
+    {
+        SkipNode* update[MAX_HEIGHT];
+        SkipNode* cur = find_update(_score, _member, update);
+        if (cur == nullptr) { return false; }
+        unlink_node(cur, update);
+        destroy_node(cur);
+        if (element_count == 0) { reset(); }
+        return true;
+    }
+
+    // Moves _member to _new_score, keeping the node in place when its
+    // neighbours still bracket the new score.
+    bool update_score(int64_t _score, std::string_view _member, int64_t _new_score)
+    {
+        SkipNode* update[MAX_HEIGHT];
+        SkipNode* cur = find_update(_score, _member, update);
+        if (cur == nullptr) { return false; }
+        const SkipNode* next = cur->level[0].forward;
+        if ((update[0] == header || node_less(update[0], _new_score, _member)) &&
+            (next == nullptr || !node_less(next, _new_score, _member)))
+        {
+            cur->score = _new_score;
+            return true;
+        }
+        unlink_node(cur, update);
+        cur->score = _new_score;
+        insert_node(cur);
+        return true;
+    }
+
+    // 1-based rank of (_score, _member), or 0 when it is not in the list.
+    size_t rank_of(int64_t _score, std::string_view _member) const
+    {
+        const SkipNode* cur = header;
+        size_t rank = 0;
+
+        for (int i = skiplist_level; i >= 0; --i)
+        {
+            while (cur->level[i].forward != nullptr && !node_greater(cur->level[i].forward, _score, _member))
+            {
+                rank += cur->level[i].span;
+                cur = cur->level[i].forward;
+            }
+        }
+        return cur != header && cur->score == _score && cur->member == _member ? rank : 0;
+    }
+
+    // Node at 1-based rank, or nullptr when rank is out of range.
+    const SkipNode* node_at(size_t rank) const
+    {
+        const SkipNode* cur = header;
+        size_t traversed = 0;
+
+        for (int i = skiplist_level; i >= 0; --i)
+        {
+            while (cur->level[i].forward != nullptr && traversed + cur->level[i].span <= rank)
+            {
+                traversed += cur->level[i].span;
+                cur = cur->level[i].forward;
+            }
+            if (traversed == rank) { return cur != header ? cur : nullptr; }
+        }
+        return nullptr;
+    }
+
+    // Number of elements with score < _score, or score <= _score when inclusive.
+    size_t count_below(int64_t _score, bool inclusive) const
+    {
+        const SkipNode* cur = header;
+        size_t rank = 0;
+
+        for (int i = skiplist_level; i >= 0; --i)
+        {
+            while (cur->level[i].forward != nullptr &&
+                   (cur->level[i].forward->score < _score || (inclusive && cur->level[i].forward->score == _score)))
+            {
+                rank += cur->level[i].span;
+                cur = cur->level[i].forward;
+            }
+        }
+        return rank;
+    }
+
+    int size() const { return element_count; }
+
+    size_t memory_usage() const { return arena.memory_usage(); }
+
+private:
+    static constexpr int MAX_HEIGHT = 64;
+
+    int max_level;
+    int skiplist_level;
+    int element_count;
+    uint64_t rng_state;
+    SkipNodeArena arena;
+    SkipNode* header;
+
+    static bool node_less(const SkipNode* node, int64_t _score, std::string_view _member)
+    {
+        return node->score < _score || (node->score == _score && std::string_view(node->member) < _member);
+    }
+
+    static bool node_greater(const SkipNode* node, int64_t _score, std::string_view _member)
+    {
+        return node->score > _score || (node->score == _score && std::string_view(node->member) > _member);
+    }
+
+    SkipNode* find_update(int64_t _score, std::string_view _member, SkipNode** update)
+    {
+        SkipNode* cur = header;
+
+        for (int i = skiplist_level; i >= 0; --i)
+        {
+            while (cur->level[i].forward != nullptr && node_less(cur->level[i].forward, _score, _member)) { cur = cur->level[i].forward; }
+            update[i] = cur;
+        }
+        cur = cur->level[0].forward;
+        return cur != nullptr && cur->score == _score && cur->member == _member ? cur : nullptr;
+    }
+
+    void insert_node(SkipNode* new_node)
+    {
+        SkipNode* cur = header;
+        SkipNode* update[MAX_HEIGHT];
+        size_t rank[MAX_HEIGHT];
+
+        for (int i = skiplist_level; i >= 0; --i)
+        {
+            rank[i] = i == skiplist_level ? 0 : rank[i + 1];
+            while (cur->level[i].forward != nullptr && node_less(cur->level[i].forward, new_node->score, new_node->member))
+            {
+                rank[i] += cur->level[i].span;
+                cur = cur->level[i].forward;
+            }
+            update[i] = cur;
+        }
+
+        int node_level = new_node->height - 1;
+        if (skiplist_level < node_level)
+        {
+            for (int i = skiplist_level + 1; i <= node_level; ++i)
+            {
+                rank[i] = 0;
+                update[i] = header;
+                header->level[i].span = element_count;
+            }
+            skiplist_level = node_level;
+        }
+        for (int i = 0; i <= node_level; ++i)
+        {
+            new_node->level[i].forward = update[i]->level[i].forward;
+            update[i]->level[i].forward = new_node;
+            new_node->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
+            update[i]->level[i].span = rank[0] - rank[i] + 1;
+        }
+        for (int i = node_level + 1; i <= skiplist_level; ++i) { ++update[i]->level[i].span; }
+        ++element_count;
+    }
+
+    void unlink_node(SkipNode* node, SkipNode** update)
+    {
+        for (int i = 0; i <= skiplist_level; ++i)
+        {
+            if (update[i]->level[i].forward == node)
+            {
+                update[i]->level[i].span += node->level[i].span - 1;
+                update[i]->level[i].forward = node->level[i].forward;
+            }
+            else
+            {
+                --update[i]->level[i].span;
+            }
+        }
+        while (skiplist_level > 0 && header->level[skiplist_level].forward == nullptr) { --skiplist_level; }
+        --element_count;
+    }
+
+    void reset()
+    {
+        header->member.~basic_string();
+        arena.release();
+        skiplist_level = 0;
+        header = create_node(int64_t(), std::string_view(), max_level);
+    }
+};
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef KV_URING_H
+#define KV_URING_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+/*
+ * Minimal io_uring ring driven through the raw syscalls: one submission and
+ * completion queue mapped with IORING_FEAT_SINGLE_MMAP plus an optional
+ * provided-buffer ring for multishot receives. The ring is created with
+ * SINGLE_ISSUER | DEFER_TASKRUN, so it must only be used by the thread that
+ * called init(), and init() fails on kernels older than 6.1, which is what
+ * the caller uses to fall back to epoll.
+ */
+class IoUring
+{
+public:
+    IoUring() {}
+
+    ~IoUring()
+    {
+        if (buf_base) { munmap(buf_base, buf_count * buf_size); }
+        if (buf_ring) { munmap(buf_ring, buf_ring_bytes); }
+        if (sqes) { munmap(sqes, sq_entries * sizeof(struct io_uring_sqe)); }
+        if (ring_ptr) { munmap(ring_ptr, ring_bytes); }
+        if (ring_fd >= 0) { close(ring_fd); }
+    }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    bool init(unsigned entries)
+    {
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 4;
+        ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        if (ring_fd < 0) { return false; }
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) { return false; }
+
+        ring_bytes = std::max<size_t>(p.sq_off.array + p.sq_entries * sizeof(unsigned), p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+        void* ring = mmap(nullptr, ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if (ring == MAP_FAILED) { return false; }
+        ring_ptr = static_cast<char*>(ring);
+        sq_entries = p.sq_entries;
+        void* sqe_mem = mmap(nullptr, sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (sqe_mem == MAP_FAILED) { return false; }
+        sqes = static_cast<struct io_uring_sqe*>(sqe_mem);
+
+        sq_head = reinterpret_cast<unsigned*>(ring_ptr + p.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(ring_ptr + p.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(ring_ptr + p.sq_off.ring_mask);
+        cq_head = reinterpret_cast<unsigned*>(ring_ptr + p.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(ring_ptr + p.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(ring_ptr + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(ring_ptr + p.cq_off.cqes);
+        unsigned* sq_array = reinterpret_cast<unsigned*>(ring_ptr + p.sq_off.array);
+        for (unsigned i = 0; i < sq_entries; ++i) { sq_array[i] = i; }
+        sqe_tail = *sq_tail;
+        return true;
+    }
+
+    // Registers count buffers of size bytes as buffer group bgid for
+    // IOSQE_BUFFER_SELECT receives.
+    bool setup_buf_ring(uint16_t bgid, unsigned count, unsigned size)
+    {
+        buf_ring_bytes = count * sizeof(struct io_uring_buf);
+        void* mem = mmap(nullptr, buf_ring_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) { return false; }
+        buf_ring = static_cast<struct io_uring_buf_ring*>(mem);
+        void* bufs = mmap(nullptr, size_t(count) * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (bufs == MAP_FAILED) { return false; }
+        buf_base = static_cast<char*>(bufs);
+        buf_count = count, buf_size = size;
+
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring);
+        reg.ring_entries = count;
+        reg.bgid = bgid;
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) { return false; }
+        for (unsigned i = 0; i < count; ++i) { recycle_buf(static_cast<uint16_t>(i)); }
+        publish_bufs();
+        return true;
+    }
+
+    char* buf_addr(uint16_t bid) const { return buf_base + size_t(bid) * buf_size; }
+
+    // Hands a provided buffer back to the kernel; visible after publish_bufs().
+    void recycle_buf(uint16_t bid)
+    {
+        struct io_uring_buf* buf = &buf_ring->bufs[buf_tail & (buf_count - 1)];
+        buf->addr = reinterpret_cast<uint64_t>(buf_addr(bid));
+        buf->len = buf_size;
+        buf->bid = bid;
+        ++buf_tail;
+    }
+
+    void publish_bufs() { __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE); }
+
+    // Next free submission entry, zeroed. Submits queued entries first when
+    // the queue is full.
+    struct io_uring_sqe* get_sqe()
+    {
+        if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) { submit_and_wait(0, 0); }
+        struct io_uring_sqe* sqe = &sqes[sqe_tail & sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        ++sqe_tail;
+        return sqe;
+    }
+
+    // Submits everything queued and, when wait_nr > 0, waits up to timeout_ms
+    // for completions. Returns -errno on failure, -ETIME on timeout.
+    int submit_and_wait(unsigned wait_nr, int timeout_ms)
+    {
+        __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+        unsigned to_submit = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        struct __kernel_timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000LL };
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        ++enter_calls;
+        long ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_nr, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        return ret < 0 ? -errno : static_cast<int>(ret);
+    }
+
+    // Calls f(cqe) for every completion posted so far and returns the count.
+    template <typename F>
+    unsigned for_each_cqe(F&& f)
+    {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (unsigned i = head; i != tail; ++i) { f(cqes[i & cq_mask]); }
+        __atomic_store_n(cq_head, tail, __ATOMIC_RELEASE);
+        return tail - head;
+    }
+
+    size_t enter_count() const { return enter_calls; }
+
+private:
+    int ring_fd = -1;
+    char* ring_ptr = nullptr;
+    size_t ring_bytes = 0;
+    unsigned sq_entries = 0;
+    unsigned sq_mask = 0;
+    unsigned cq_mask = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned sqe_tail = 0;
+    struct io_uring_sqe* sqes = nullptr;
+    struct io_uring_cqe* cqes = nullptr;
+
+    struct io_uring_buf_ring* buf_ring = nullptr;
+    size_t buf_ring_bytes = 0;
+    char* buf_base = nullptr;
+    unsigned buf_count = 0;
+    unsigned buf_size = 0;
+    uint16_t buf_tail = 0;
+
+    size_t enter_calls = 0;
+};
+
+#endif
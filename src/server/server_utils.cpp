@@ -6,6 +6,29 @@ void signal_handler(int signum)
     AsyncLog::AsyncLog::Instance().Close();
 }
 
+bool parse_config(int argc, char* argv[])
+{
+    auto& config = ServerConfig::Instance();
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string opt = argv[i];
+        int64_t val = 0;
+        if (i == 1 && str_to_int(opt, val))
+        {
+            config.event_loops = static_cast<int>(val);
+            continue;
+        }
+        if (i + 1 >= argc) { return false; }
+        std::string arg = argv[i + 1];
+        if (opt == "--loops" && str_to_int(arg, val)) { config.event_loops = static_cast<int>(val); }
+        else if (opt == "--max-request" && str_to_int(arg, val)) { config.max_request = static_cast<size_t>(val); }
+        else if (opt == "--io" && (arg == "epoll" || arg == "uring")) { config.use_uring = arg == "uring"; }
+        else { return false; }
+        ++i;
+    }
+    return config.event_loops > 0 && config.event_loops <= MAX_EVENT_LOOPS && config.max_request >= BUF_MIN_SIZE;
+}
+
 void format_asynclog_write(const char* file_name, const char* func_name, int cur_line, const char* log_mes, AsyncLog::LogLevel level)
 {
     std::string strprint = "In file " + std::string(file_name) + " function(" + std::string(func_name) + ")";
@@ -93,6 +116,7 @@ int open_listenfd(const char* port)
     {
         if ((listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) { continue; }
         setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const void*>(&optval), sizeof(int));
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<const void*>(&optval), sizeof(int));
         if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0) { break; }
         if (close(listenfd) < 0)
         {
@@ -163,7 +187,7 @@ void out_nil(std::string& out)
     out.push_back(SERIAL_NIL);
 }
 
-void out_str(std::string& out, const std::string& val)
+void out_str(std::string& out, std::string_view val)
 {
     out.push_back(SERIAL_STR);
     uint32_t len = static_cast<uint32_t>(val.size());
@@ -177,7 +201,7 @@ void out_int(std::string& out, int64_t val)
     out.append(reinterpret_cast<const char*>(&val), 8);
 }
 
-void out_err(std::string& out, int32_t code, const std::string& msg)
+void out_err(std::string& out, int32_t code, std::string_view msg)
 {
     out.push_back(SERIAL_ERR);
     out.append(reinterpret_cast<const char*>(&code), 4);
@@ -192,7 +216,7 @@ void out_arr(std::string& out, uint32_t n)
     out.append(reinterpret_cast<const char*>(&n), 4);
 }
 
-int parse_request(const uint8_t* buf, size_t len, std::vector<std::string>& out)
+int parse_request(const uint8_t* buf, size_t len, CmdArgs& out)
 {
     if (len < 4) { return -1; }
     uint32_t n = 0;
@@ -206,7 +230,7 @@ int parse_request(const uint8_t* buf, size_t len, std::vector<std::string>& out)
         uint32_t sz = 0;
         memcpy(&sz, &buf[pos], 4);
         if (pos + 4 + sz > len) { return -1; }
-        out.push_back(std::string(buf + pos + 4, buf + pos + 4 + sz));
+        out.push_back(std::string_view(reinterpret_cast<const char*>(buf) + pos + 4, sz));
         pos += 4 + sz;
     }
     return pos != len ? -1 : 0;
@@ -219,65 +243,85 @@ int accept_new_connection(std::vector<std::unique_ptr<ConnectionNode>>& fd_to_co
     int connfd = Accept(fd, reinterpret_cast<struct sockaddr*>(&client_addr), &socklen);
 
     fd_set_nb(connfd);
+    register_connection(fd_to_connection, connfd);
+    return connfd;
+}
+
+void register_connection(std::vector<std::unique_ptr<ConnectionNode>>& fd_to_connection, int connfd)
+{
     std::unique_ptr<ConnectionNode> conn = std::make_unique<ConnectionNode>();
     conn->fd = connfd;
     conn->state = STATE_REQ;
     conn->rbuf_size = 0;
-    conn->wbuf_size = 0;
     conn->wbuf_sent = 0;
     if (fd_to_connection.size() <= static_cast<size_t>(conn->fd))
     {
         fd_to_connection.resize(conn->fd + 1);
     }
     fd_to_connection[conn->fd] = std::move(conn);
-    return connfd;
 }
 
-bool judge_cmd(const std::string& word, const char* cmd)
+bool judge_cmd(std::string_view word, const char* cmd)
+{
+    return word.size() == strlen(cmd) && 0 == strncasecmp(word.data(), cmd, word.size());
+}
+
+bool str_to_int(std::string_view s, int64_t& out)
 {
-    return 0 == strcasecmp(word.c_str(), cmd);
+    const char* first = s.data();
+    const char* last = s.data() + s.size();
+    if (first != last && *first == '+') { ++first; }
+    auto res = std::from_chars(first, last, out);
+    return res.ec == std::errc() && res.ptr == last;
 }
 
-bool str_to_int(const std::string& s, int64_t& out)
+bool str_to_score(std::string_view s, int64_t& out)
 {
-    char* endp = NULL;
-    out = strtoll(s.c_str(), &endp, 10);
-    return endp == s.c_str() + s.size();
+    if (judge_cmd(s, "-inf")) { out = INT64_MIN; return true; }
+    if (judge_cmd(s, "+inf") || judge_cmd(s, "inf")) { out = INT64_MAX; return true; }
+    return str_to_int(s, out);
 }
 
-void do_keys(const std::vector<std::string>& cmd, std::string& out)
+void do_keys(const CmdArgs& cmd, std::string& out)
 {
-    out_arr(out, static_cast<uint32_t>(KvStroageData::Instance().hsize() + KvStroageData::Instance().zsize()));
-    for (auto& key : KvStroageData::Instance().get_all_keys()) { out_str(out, key); }
+    auto keys = KvStroageData::Instance().get_all_keys();
+    out_arr(out, static_cast<uint32_t>(keys.size()));
+    for (auto& key : keys) { out_str(out, key); }
 }
 
-void do_get(const std::vector<std::string>& cmd, std::string& out)
+void do_get(const CmdArgs& cmd, std::string& out)
 {
-    auto& gmap = KvStroageData::Instance().hstrhash_ref();
-    if (gmap.count(cmd[2]))
+    auto& shard = KvStroageData::Instance().shard_ref(cmd[2]);
+    std::shared_lock<std::shared_mutex> lk(shard.rwlock);
+    auto& gmap = shard.hstrhash;
+    auto val = gmap.find(cmd[2]);
+    if (val)
     {
-        out_str(out, gmap[cmd[2]]);
+        out_str(out, *val);
         return;
     }
     out_nil(out);
 }
 
-void do_set(const std::vector<std::string>& cmd, std::string& out)
+void do_set(const CmdArgs& cmd, std::string& out)
 {
-    auto& gmap = KvStroageData::Instance().hstrhash_ref();
-    gmap[cmd[2]] = cmd[3];
+    auto& shard = KvStroageData::Instance().shard_ref(cmd[2]);
+    std::unique_lock<std::shared_mutex> lk(shard.rwlock);
+    auto& gmap = shard.hstrhash;
+    gmap.insert_or_assign(cmd[2], cmd[3]);
     out_nil(out);
 }
 
-void do_del(const std::vector<std::string>& cmd, std::string& out)
+void do_del(const CmdArgs& cmd, std::string& out)
 {
-    auto& gmap = KvStroageData::Instance().hstrhash_ref();
-    int ret = gmap.count(cmd[2]);
-    if (ret) { gmap.erase(cmd[2]); }
+    auto& shard = KvStroageData::Instance().shard_ref(cmd[2]);
+    std::unique_lock<std::shared_mutex> lk(shard.rwlock);
+    auto& gmap = shard.hstrhash;
+    int ret = gmap.erase(cmd[2]);
     out_int(out, ret);
 }
 
-void do_zadd(const std::vector<std::string>& cmd, std::string& out)
+void do_zadd(const CmdArgs& cmd, std::string& out)
 {
     int64_t score = 0;
     if (!str_to_int(cmd[2], score))
@@ -285,165 +329,313 @@ void do_zadd(const std::vector<std::string>& cmd, std::string& out)
         out_err(out, ERR_TYPE, "expect score number");
         return;
     }
-    auto& zset = KvStroageData::Instance().hzset_ref();
-    auto& zlist = KvStroageData::Instance().hzlist_ref();
-    if (!zset.count(cmd[3]) && !zlist.search(score))
+    auto& shard = KvStroageData::Instance().shard_ref(cmd[1]);
+    std::unique_lock<std::shared_mutex> lk(shard.rwlock);
+    auto& zset = *shard.zsets.try_emplace(cmd[1]).first;
+    if (!zset) { zset = std::make_unique<ZSet>(); }
+    auto member = zset->members.try_emplace(cmd[3]);
+    if (member.second)
     {
-        zset[cmd[3]] = score;
-        zlist.insert(score, cmd[3]);
+        *member.first = score;
+        zset->zlist.insert(score, cmd[3]);
+        ++shard.zmembers;
         out_int(out, 1);
         return;
     }
-    out_err(out, ERR_ARG, "key or value already exists");
+    if (*member.first != score)
+    {
+        zset->zlist.update_score(*member.first, cmd[3], score);
+        *member.first = score;
+    }
+    out_int(out, 0);
 }
 
-void do_zrem(const std::vector<std::string>& cmd, std::string& out)
+void do_zrem(const CmdArgs& cmd, std::string& out)
 {
-    auto& zset = KvStroageData::Instance().hzset_ref();
-    int ret = zset.count(cmd[2]);
+    auto& shard = KvStroageData::Instance().shard_ref(cmd[1]);
+    std::unique_lock<std::shared_mutex> lk(shard.rwlock);
+    ZSet* zset = shard.zset_find(cmd[1]);
+    auto val = zset ? zset->members.find(cmd[2]) : nullptr;
+    int ret = val != nullptr;
     if (ret)
     {
-        auto val = zset[cmd[2]];
-        auto& zlist = KvStroageData::Instance().hzlist_ref();
-        if (zlist.cancel(val)) { zset.erase(cmd[2]); }
-        else { ret = 0; }
+        zset->zlist.cancel(*val, cmd[2]);
+        zset->members.erase(cmd[2]);
+        --shard.zmembers;
+        if (zset->members.size() == 0) { shard.zsets.erase(cmd[1]); }
     }
     out_int(out, ret);
 }
 
-void do_zscore(const std::vector<std::string>& cmd, std::string& out)
+void do_zscore(const CmdArgs& cmd, std::string& out)
 {
-    auto& zset = KvStroageData::Instance().hzset_ref();
-    if (zset.count(cmd[2]))
+    auto& shard = KvStroageData::Instance().shard_ref(cmd[1]);
+    std::shared_lock<std::shared_mutex> lk(shard.rwlock);
+    ZSet* zset = shard.zset_find(cmd[1]);
+    auto val = zset ? zset->members.find(cmd[2]) : nullptr;
+    if (val)
     {
-        out_int(out, zset[cmd[2]]);
+        out_int(out, *val);
         return;
     }
     out_err(out, ERR_ARG, "key don't exists");
 }
 
-void do_zcard(const std::vector<std::string>& cmd, std::string& out)
+void do_zcard(const CmdArgs& cmd, std::string& out)
 {
-    out_int(out, KvStroageData::Instance().zsize());
+    auto& shard = KvStroageData::Instance().shard_ref(cmd[1]);
+    std::shared_lock<std::shared_mutex> lk(shard.rwlock);
+    ZSet* zset = shard.zset_find(cmd[1]);
+    out_int(out, zset ? zset->zlist.size() : 0);
 }
 
-void do_request(std::vector<std::string>& cmd, std::string& out)
+void do_zrank(const CmdArgs& cmd, std::string& out)
 {
-    if (cmd.size() == 1 && judge_cmd(cmd[0], "keys"))
-    {
-        do_keys(cmd, out);
-        format_asynclog_write(__FILE__, __func__, __LINE__ - 1, "execute do_keys operation.\n", AsyncLog::LogLevel::INFO);
-        return;
-    }
-    else if (cmd.size() == 3 && judge_cmd(cmd[0], "get") && judge_cmd(cmd[1], "str"))
+    auto& shard = KvStroageData::Instance().shard_ref(cmd[1]);
+    std::shared_lock<std::shared_mutex> lk(shard.rwlock);
+    ZSet* zset = shard.zset_find(cmd[1]);
+    auto val = zset ? zset->members.find(cmd[2]) : nullptr;
+    if (val)
     {
-        do_get(cmd, out);
-        format_asynclog_write(__FILE__, __func__, __LINE__ - 1, "execute do_get operation.\n", AsyncLog::LogLevel::INFO);
+        out_int(out, static_cast<int64_t>(zset->zlist.rank_of(*val, cmd[2])) - 1);
         return;
     }
-    else if (cmd.size() == 4 && judge_cmd(cmd[0], "set") && judge_cmd(cmd[1], "str"))
+    out_err(out, ERR_ARG, "key don't exists");
+}
+
+void out_zrange(std::string& out, const ZSet* zset, size_t first_rank, size_t count)
+{
+    out_arr(out, static_cast<uint32_t>(count));
+    const SkipNode* node = count ? zset->zlist.node_at(first_rank) : nullptr;
+    for (size_t i = 0; i < count && node != nullptr; ++i, node = node->next()) { out_str(out, node->member); }
+}
+
+void do_zrange(const CmdArgs& cmd, std::string& out)
+{
+    int64_t start = 0, stop = 0;
+    if (!str_to_int(cmd[2], start) || !str_to_int(cmd[3], stop))
     {
-        do_set(cmd, out);
-        format_asynclog_write(__FILE__, __func__, __LINE__ - 1, "execute do_set operation.\n", AsyncLog::LogLevel::INFO);
+        out_err(out, ERR_TYPE, "expect index number");
         return;
     }
-    else if (cmd.size() == 3 && judge_cmd(cmd[0], "del") && judge_cmd(cmd[1], "str"))
+    auto& shard = KvStroageData::Instance().shard_ref(cmd[1]);
+    std::shared_lock<std::shared_mutex> lk(shard.rwlock);
+    ZSet* zset = shard.zset_find(cmd[1]);
+    int64_t n = zset ? zset->zlist.size() : 0;
+    if (start < 0) { start += n; }
+    if (stop < 0) { stop += n; }
+    start = std::max<int64_t>(start, 0);
+    stop = std::min<int64_t>(stop, n - 1);
+    out_zrange(out, zset, static_cast<size_t>(start) + 1, start <= stop ? static_cast<size_t>(stop - start + 1) : 0);
+}
+
+void do_zrangebyscore(const CmdArgs& cmd, std::string& out)
+{
+    int64_t min = 0, max = 0, offset = 0, limit = -1;
+    if (!str_to_score(cmd[2], min) || !str_to_score(cmd[3], max))
     {
-        do_del(cmd, out);
-        format_asynclog_write(__FILE__, __func__, __LINE__ - 1, "execute do_del operation.\n", AsyncLog::LogLevel::INFO);
+        out_err(out, ERR_TYPE, "expect score number");
         return;
     }
-    else if (cmd.size() == 4 && judge_cmd(cmd[0], "zadd") && judge_cmd(cmd[1], "zset"))
+    if (cmd.size() != 4 && (cmd.size() != 7 || !judge_cmd(cmd[4], "limit") || !str_to_int(cmd[5], offset) || !str_to_int(cmd[6], limit) || offset < 0))
     {
-        do_zadd(cmd, out);
-        format_asynclog_write(__FILE__, __func__, __LINE__ - 1, "execute do_zadd operation.\n", AsyncLog::LogLevel::INFO);
+        out_err(out, ERR_ARG, "expect limit offset count");
         return;
     }
-    else if (cmd.size() == 3 && judge_cmd(cmd[0], "zrem") && judge_cmd(cmd[1], "zset"))
+    auto& shard = KvStroageData::Instance().shard_ref(cmd[1]);
+    std::shared_lock<std::shared_mutex> lk(shard.rwlock);
+    ZSet* zset = shard.zset_find(cmd[1]);
+    size_t below = zset ? zset->zlist.count_below(min, false) : 0;
+    size_t total = zset && min <= max ? zset->zlist.count_below(max, true) - below : 0;
+    size_t count = total > static_cast<size_t>(offset) ? total - offset : 0;
+    if (limit >= 0) { count = std::min(count, static_cast<size_t>(limit)); }
+    out_zrange(out, zset, below + offset + 1, count);
+}
+
+void do_zcount(const CmdArgs& cmd, std::string& out)
+{
+    int64_t min = 0, max = 0;
+    if (!str_to_score(cmd[2], min) || !str_to_score(cmd[3], max))
     {
-        do_zrem(cmd, out);
-        format_asynclog_write(__FILE__, __func__, __LINE__ - 1, "execute do_zrem operation.\n", AsyncLog::LogLevel::INFO);
+        out_err(out, ERR_TYPE, "expect score number");
         return;
     }
-    else if (cmd.size() == 3 && judge_cmd(cmd[0], "zscore") && judge_cmd(cmd[1], "zset"))
-    {
-        do_zscore(cmd, out);
-        format_asynclog_write(__FILE__, __func__, __LINE__ - 1, "execute do_zscore operation.\n", AsyncLog::LogLevel::INFO);
+    auto& shard = KvStroageData::Instance().shard_ref(cmd[1]);
+    std::shared_lock<std::shared_mutex> lk(shard.rwlock);
+    ZSet* zset = shard.zset_find(cmd[1]);
+    size_t count = zset && min <= max ? zset->zlist.count_below(max, true) - zset->zlist.count_below(min, false) : 0;
+    out_int(out, static_cast<int64_t>(count));
+}
+
+void do_info(const CmdArgs& cmd, std::string& out)
+{
+    auto& db = KvStroageData::Instance();
+    size_t dicts = 0, moved = 0, total = 0;
+    db.rehash_stats(dicts, moved, total);
+    char progress[32];
+    snprintf(progress, sizeof(progress), "%.2f", total ? 100.0 * moved / total : 100.0);
+
+    std::vector<std::string> lines = {
+        "str_keys:" + std::to_string(db.hsize()),
+        "zset_keys:" + std::to_string(db.zkeys()),
+        "zset_members:" + std::to_string(db.zsize()),
+        "rehashing_dicts:" + std::to_string(dicts),
+        "rehash_groups_moved:" + std::to_string(moved),
+        "rehash_groups_total:" + std::to_string(total),
+        "rehash_progress:" + std::string(progress),
+    };
+    out_arr(out, static_cast<uint32_t>(lines.size()));
+    for (auto& line : lines) { out_str(out, line); }
+}
+
+static constexpr KvCommand command_table[] = {
+    { "keys", 1, CMD_READONLY | CMD_ADMIN, do_keys },
+    { "get", 3, CMD_READONLY | CMD_STR_TYPE, do_get },
+    { "set", 4, CMD_WRITE | CMD_STR_TYPE, do_set },
+    { "del", 3, CMD_WRITE | CMD_STR_TYPE, do_del },
+    { "zadd", 4, CMD_WRITE, do_zadd },
+    { "zrem", 3, CMD_WRITE, do_zrem },
+    { "zscore", 3, CMD_READONLY, do_zscore },
+    { "zcard", 2, CMD_READONLY, do_zcard },
+    { "zrank", 3, CMD_READONLY, do_zrank },
+    { "zrange", 4, CMD_READONLY, do_zrange },
+    { "zrangebyscore", -4, CMD_READONLY, do_zrangebyscore },
+    { "zcount", 4, CMD_READONLY, do_zcount },
+    { "info", 1, CMD_READONLY | CMD_ADMIN, do_info },
+};
+
+static constexpr auto command_index = build_command_index<CMD_INDEX_SLOTS>(command_table);
+static_assert(command_index.seed != command_index.NO_SEED, "no collision-free seed for the command table");
+
+const KvCommand* lookup_command(std::string_view name)
+{
+    size_t row = command_index.lookup(name);
+    return row != 0 && judge_cmd(name, command_table[row - 1].name) ? &command_table[row - 1] : nullptr;
+}
+
+void do_request(const CmdArgs& cmd, std::string& out)
+{
+    const KvCommand* command = cmd.size() > 0 ? lookup_command(cmd[0]) : nullptr;
+    if (command == nullptr)
+    {
+        out_err(out, ERR_UNKNOWN, "Unknown cmd");
+        format_asynclog_write(__FILE__, __func__, __LINE__ - 1, "Unknown cmd.\n", AsyncLog::LogLevel::WARN);
         return;
     }
-    else if (cmd.size() == 2 && judge_cmd(cmd[0], "zcard") && judge_cmd(cmd[1], "zset"))
+    size_t argc = cmd.size();
+    if ((command->arity > 0 && argc != static_cast<size_t>(command->arity)) ||
+        (command->arity < 0 && argc < static_cast<size_t>(-command->arity)) ||
+        ((command->flags & CMD_STR_TYPE) && !judge_cmd(cmd[1], "str")))
     {
-        do_zcard(cmd, out);
-        format_asynclog_write(__FILE__, __func__, __LINE__ - 1, "execute do_zcard operation.\n", AsyncLog::LogLevel::INFO);
+        out_err(out, ERR_ARG, "wrong number or type of arguments");
+        format_asynclog_write(__FILE__, __func__, __LINE__ - 1, "wrong arguments.\n", AsyncLog::LogLevel::WARN);
         return;
     }
-    out_err(out, ERR_UNKNOWN, "Unknown cmd");
-    format_asynclog_write(__FILE__, __func__, __LINE__ - 1, "Unknown cmd.\n", AsyncLog::LogLevel::WARN);
+    command->handler(cmd, out);
+    std::string log_message = "execute do_" + std::string(command->name) + " operation.\n";
+    format_asynclog_write(__FILE__, __func__, __LINE__ - 2, log_message.c_str(), AsyncLog::LogLevel::INFO);
 }
 
-bool try_one_request(std::unique_ptr<ConnectionNode>& conn)
+bool try_one_request(std::unique_ptr<ConnectionNode>& conn, size_t& consumed)
 {
-    if (conn->rbuf_size < 4) { return false; }
+    size_t avail = conn->rbuf_size - consumed;
+    if (avail < 4) { return false; }
     uint32_t len = 0;
-    memcpy(&len, &conn->rbuf[0], 4);
-    if (len > MAX_MSG)
+    memcpy(&len, &conn->rbuf[consumed], 4);
+    if (len > ServerConfig::Instance().max_request)
     {
         fprintf(stderr, "command is too long.\n");
         format_asynclog_write(__FILE__, __func__, __LINE__ - 3, "command is too long.\n", AsyncLog::LogLevel::WARN);
         conn->state = STATE_END;
         return false;
     }
-    if (4 + len > conn->rbuf_size) { return false; }
+    if (4 + len > avail) { return false; }
 
-    std::vector<std::string> cmd;
-    if (parse_request(&conn->rbuf[4], len, cmd) < 0)
+    CmdArgs cmd;
+    if (parse_request(reinterpret_cast<const uint8_t*>(&conn->rbuf[consumed + 4]), len, cmd) < 0)
     {
         fprintf(stderr, "bad request.\n");
         format_asynclog_write(__FILE__, __func__, __LINE__ - 3, "bad request.\n", AsyncLog::LogLevel::WARN);
         conn->state = STATE_END;
         return false;
     }
-    std::string out;
-    do_request(cmd, out);
-    if (4 + out.size() > MAX_MSG)
+    if (conn->wbufs.empty() || conn->wbufs.back().size() >= WBUF_CHUNK_SIZE)
+    {
+        conn->wbufs.push_back(BufferPool::Local().acquire(WBUF_CHUNK_SIZE));
+        conn->wbufs.back().clear();
+    }
+    std::string& wbuf = conn->wbufs.back();
+    size_t head = wbuf.size();
+    wbuf.append(4, '\0');
+    do_request(cmd, wbuf);
+    if (wbuf.size() - head - 4 > MAX_RESPONSE)
     {
-        out.clear();
-        out_err(out, ERR_TOO_BIG, "response is too big.");
+        wbuf.resize(head + 4);
+        out_err(wbuf, ERR_TOO_BIG, "response is too big.");
     }
-    uint32_t wlen = static_cast<uint32_t>(out.size());
-    memcpy(&conn->wbuf[0], &wlen, 4);
-    memcpy(&conn->wbuf[4], out.c_str(), out.size());
-    conn->wbuf_size = 4 + wlen;
+    uint32_t wlen = static_cast<uint32_t>(wbuf.size() - head - 4);
+    memcpy(&wbuf[head], &wlen, 4);
+    consumed += 4 + len;
+    return true;
+}
 
-    size_t remain = conn->rbuf_size - 4 - len;
-    if (remain > 0)
+void drain_requests(std::unique_ptr<ConnectionNode>& conn)
+{
+    size_t consumed = 0;
+    while (try_one_request(conn, consumed)) { continue; }
+
+    size_t remain = conn->rbuf_size - consumed;
+    if (remain > 0 && consumed > 0)
     {
-        memmove(conn->rbuf, &conn->rbuf[4 + len], remain);
+        memmove(&conn->rbuf[0], &conn->rbuf[consumed], remain);
     }
-    conn->rbuf_size = remain, conn->state = STATE_RES;
-    state_res(conn);
-    return conn->state == STATE_REQ;
+    conn->rbuf_size = remain;
+    if (remain == 0) { BufferPool::Local().release(conn->rbuf); }
+    if (conn->state == STATE_REQ && !conn->wbufs.empty()) { conn->state = STATE_RES; }
+}
+
+void reserve_rbuf(std::unique_ptr<ConnectionNode>& conn, size_t want)
+{
+    if (conn->rbuf.size() >= want) { return; }
+    std::string buf = BufferPool::Local().acquire(want);
+    buf.resize(buf.capacity());
+    memcpy(&buf[0], conn->rbuf.data(), conn->rbuf_size);
+    BufferPool::Local().release(conn->rbuf);
+    conn->rbuf = std::move(buf);
 }
 
 bool try_fill_buffer(std::unique_ptr<ConnectionNode>& conn)
 {
-    if (conn->rbuf_size >= sizeof(conn->rbuf))
+    size_t want = BUF_MIN_SIZE;
+    if (conn->rbuf_size >= 4)
+    {
+        uint32_t len = 0;
+        memcpy(&len, &conn->rbuf[0], 4);
+        want = std::max(want, std::min<size_t>(4 + len, 4 + ServerConfig::Instance().max_request));
+    }
+    reserve_rbuf(conn, want);
+    if (conn->rbuf_size >= conn->rbuf.size())
     {
         fprintf(stderr, "KV storage failed, please check the backend logs.\n");
         format_asynclog_write(__FILE__, __func__, __LINE__ - 3, "read() error: ", AsyncLog::LogLevel::ERROR);
         exit(EXIT_FAILURE);
     }
     ssize_t bytes_read = 0;
+    size_t cap = conn->rbuf.size() - conn->rbuf_size;
     do
     {
-        size_t cap = sizeof(conn->rbuf) - conn->rbuf_size;
         bytes_read = read(conn->fd, &conn->rbuf[conn->rbuf_size], cap);
     } while (bytes_read < 0 && errno == EINTR);
     if (bytes_read < 0)
     {
-        if (errno == EAGAIN) { return false; }
+        if (conn->rbuf_size == 0) { BufferPool::Local().release(conn->rbuf); }
+        if (errno == EAGAIN)
+        {
+            conn->readable = false;
+            return false;
+        }
         fprintf(stderr, "read() error.\n");
-        format_asynclog_write(__FILE__, __func__, __LINE__ - 4, "read() error: ", AsyncLog::LogLevel::ERROR);
+        format_asynclog_write(__FILE__, __func__, __LINE__ - 5, "read() error: ", AsyncLog::LogLevel::ERROR);
         conn->state = STATE_END;
         return false;
     }
@@ -455,45 +647,71 @@ bool try_fill_buffer(std::unique_ptr<ConnectionNode>& conn)
         conn->state = STATE_END;
         return false;
     }
+    // A short read drained the socket; more data will raise a new edge, so
+    // skip the read() that would only return EAGAIN.
+    if (static_cast<size_t>(bytes_read) < cap) { conn->readable = false; }
     conn->rbuf_size += static_cast<size_t>(bytes_read);
-    if (conn->rbuf_size > sizeof(conn->rbuf))
+    if (conn->rbuf_size > conn->rbuf.size())
     {
         fprintf(stderr, "KV storage failed, please check the backend logs.\n");
         format_asynclog_write(__FILE__, __func__, __LINE__ - 3, "read() error: ", AsyncLog::LogLevel::ERROR);
         exit(EXIT_FAILURE);
     }
-    while (try_one_request(conn)) { continue; }
+    drain_requests(conn);
     return conn->state == STATE_REQ;
 }
 
+void advance_wbufs(std::unique_ptr<ConnectionNode>& conn, size_t bytes_written)
+{
+    size_t left = bytes_written, done = 0;
+    while (done < conn->wbufs.size() && left >= conn->wbufs[done].size() - conn->wbuf_sent)
+    {
+        left -= conn->wbufs[done].size() - conn->wbuf_sent;
+        conn->wbuf_sent = 0;
+        BufferPool::Local().release(conn->wbufs[done++]);
+    }
+    conn->wbufs.erase(conn->wbufs.begin(), conn->wbufs.begin() + done);
+    conn->wbuf_sent += left;
+    if (conn->wbufs.empty() && left > 0)
+    {
+        fprintf(stderr, "KV storage failed, please check the backend logs.\n");
+        format_asynclog_write(__FILE__, __func__, __LINE__ - 3, "write() error: ", AsyncLog::LogLevel::ERROR);
+        exit(EXIT_FAILURE);
+    }
+}
+
 bool try_flush_buffer(std::unique_ptr<ConnectionNode>& conn)
 {
+    struct iovec iov[IOV_BATCH];
+    int iovcnt = 0;
+    for (size_t i = 0; i < conn->wbufs.size() && iovcnt < IOV_BATCH; ++i, ++iovcnt)
+    {
+        size_t skip = i == 0 ? conn->wbuf_sent : 0;
+        iov[iovcnt].iov_base = &conn->wbufs[i][skip];
+        iov[iovcnt].iov_len = conn->wbufs[i].size() - skip;
+    }
     ssize_t bytes_written = 0;
     do
     {
-        size_t remain = conn->wbuf_size - conn->wbuf_sent;
-        bytes_written = write(conn->fd, &conn->wbuf[conn->wbuf_sent], remain);
+        bytes_written = writev(conn->fd, iov, iovcnt);
     } while (bytes_written < 0 && errno == EINTR);
     if (bytes_written < 0)
     {
-        if (errno == EAGAIN) { return false; }
+        if (errno == EAGAIN)
+        {
+            conn->writable = false;
+            return false;
+        }
         fprintf(stderr, "write() error.\n");
-        format_asynclog_write(__FILE__, __func__, __LINE__ - 4, "write() error: ", AsyncLog::LogLevel::ERROR);
+        format_asynclog_write(__FILE__, __func__, __LINE__ - 4, "writev() error: ", AsyncLog::LogLevel::ERROR);
         conn->state = STATE_END;
         return false;
     }
-    conn->wbuf_sent += static_cast<size_t>(bytes_written);
-    if (conn->wbuf_sent > conn->wbuf_size)
-    {
-        fprintf(stderr, "KV storage failed, please check the backend logs.\n");
-        format_asynclog_write(__FILE__, __func__, __LINE__ - 3, "write() error: ", AsyncLog::LogLevel::ERROR);
-        exit(EXIT_FAILURE);
-    }
-    if (conn->wbuf_sent == conn->wbuf_size)
+    advance_wbufs(conn, static_cast<size_t>(bytes_written));
+    if (conn->wbufs.empty())
     {
         conn->state = STATE_REQ;
         conn->wbuf_sent = 0;
-        conn->wbuf_size = 0;
         return false;
     }
     return true;
@@ -501,39 +719,295 @@ bool try_flush_buffer(std::unique_ptr<ConnectionNode>& conn)
 
 void state_req(std::unique_ptr<ConnectionNode>& conn)
 {
-    while (try_fill_buffer(conn)) { continue; }
+    while (conn->readable && try_fill_buffer(conn)) { continue; }
 }
 
 void state_res(std::unique_ptr<ConnectionNode>& conn)
 {
-    while (try_flush_buffer(conn)) { continue; }
+    while (conn->writable && try_flush_buffer(conn)) { continue; }
 }
 
+// Runs the connection until it is blocked on the socket: reads while it is
+// readable, flushes while it is writable, and picks reading back up once a
+// stalled response has drained, since an edge already consumed is not
+// reported again.
 void connection_io(std::unique_ptr<ConnectionNode>& conn)
 {
-    switch (conn->state)
+    while (true)
     {
-        case STATE_REQ:
+        switch (conn->state)
         {
-            state_req(conn);
-            break;
+            case STATE_REQ:
+            {
+                if (!conn->readable) { return; }
+                state_req(conn);
+                break;
+            }
+            case STATE_RES:
+            {
+                if (!conn->writable) { return; }
+                state_res(conn);
+                break;
+            }
+            case STATE_END:
+            {
+                return;
+            }
+            default:
+            {
+                fprintf(stderr, "unexpected state.\n");
+                format_asynclog_write(__FILE__, __func__, __LINE__ - 3, "unexpected state.\n", AsyncLog::LogLevel::WARN);
+                conn->state = STATE_END;
+                return;
+            }
         }
-        case STATE_RES:
+    }
+}
+
+void run_event_loop(const char* port)
+{
+    if (ServerConfig::Instance().use_uring && run_uring_loop(port)) { return; }
+    int fd = Open_listenfd(port);
+    std::vector<std::unique_ptr<ConnectionNode>> fd_to_connection;
+
+    fd_set_nb(fd);
+    int epoll_fd = Epoll_create1(EPOLL_CLOEXEC);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN, ev.data.fd = fd;
+    Epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    bool rehash_pending = false;
+    std::vector<struct epoll_event> events(SOMAXCONN);
+    while (true)
+    {
+        int ret = Epoll_wait(epoll_fd, events.data(), events.size(), rehash_pending ? REHASH_TIMEOUT_VAL : TIMEOUT_VAL);
+        if (ret == 0)
         {
-            state_res(conn);
-            break;
+            rehash_pending = KvStroageData::Instance().rehash_idle(REHASH_IDLE_US);
+            continue;
         }
-        case STATE_END:
+        for (int i = 0; i < ret; ++i)
         {
-            fprintf(stderr, "end to read and write.\n");
-            format_asynclog_write(__FILE__, __func__, __LINE__ - 3, "end to read and write.\n", AsyncLog::LogLevel::INFO);
-            break;
+            if (events[i].data.fd == fd)
+            {
+                int connfd = accept_new_connection(fd_to_connection, fd);
+                ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, ev.data.fd = connfd;
+                Epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connfd, &ev);
+            }
+            else
+            {
+                auto& conn = fd_to_connection[events[i].data.fd];
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) { conn->readable = true; }
+                if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) { conn->writable = true; }
+                connection_io(conn);
+                if (conn->state == STATE_END)
+                {
+                    // close() also drops the fd from the epoll set.
+                    close(conn->fd);
+                    fd_to_connection[conn->fd].reset(nullptr);
+                }
+            }
         }
-        default:
+    }
+    close(fd);
+    close(epoll_fd);
+}
+
+uint64_t uring_tag(uint32_t op, int fd)
+{
+    return (static_cast<uint64_t>(op) << 32) | static_cast<uint32_t>(fd);
+}
+
+void uring_arm_accept(IoUring& ring, int listenfd)
+{
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = uring_tag(URING_ACCEPT, listenfd);
+}
+
+void uring_arm_recv(IoUring& ring, std::unique_ptr<ConnectionNode>& conn)
+{
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = uring_tag(URING_RECV, conn->fd);
+    conn->recv_armed = true;
+}
+
+void uring_cancel_recv(IoUring& ring, std::unique_ptr<ConnectionNode>& conn)
+{
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = uring_tag(URING_RECV, conn->fd);
+    sqe->user_data = uring_tag(URING_CANCEL, conn->fd);
+    conn->recv_paused = true;
+}
+
+// Queues one send per pending chunk, linked so they go out in order. With
+// MSG_WAITALL the kernel retries short sends itself; if a chunk still ends
+// short, the rest of the link is cancelled and resent once all complete.
+void uring_queue_sends(IoUring& ring, std::unique_ptr<ConnectionNode>& conn)
+{
+    size_t n = conn->wbufs.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        size_t skip = i == 0 ? conn->wbuf_sent : 0;
+        struct io_uring_sqe* sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn->fd;
+        sqe->addr = reinterpret_cast<uint64_t>(conn->wbufs[i].data() + skip);
+        sqe->len = static_cast<uint32_t>(conn->wbufs[i].size() - skip);
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+        sqe->flags = i + 1 < n ? IOSQE_IO_LINK : 0;
+        sqe->user_data = uring_tag(URING_SEND, conn->fd);
+    }
+    conn->sends_inflight += static_cast<uint32_t>(n);
+}
+
+void uring_on_recv(IoUring& ring, std::unique_ptr<ConnectionNode>& conn, const struct io_uring_cqe& cqe)
+{
+    if (!(cqe.flags & IORING_CQE_F_MORE)) { conn->recv_armed = false; }
+    if (cqe.res > 0)
+    {
+        uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        if (conn->state != STATE_END)
         {
-            fprintf(stderr, "unexpected state.\n");
-            format_asynclog_write(__FILE__, __func__, __LINE__ - 3, "unexpected state.\n", AsyncLog::LogLevel::WARN);
-            break;
+            reserve_rbuf(conn, conn->rbuf_size + cqe.res);
+            memcpy(&conn->rbuf[conn->rbuf_size], ring.buf_addr(bid), cqe.res);
+            conn->rbuf_size += cqe.res;
+        }
+        ring.recycle_buf(bid);
+        return;
+    }
+    if (cqe.res == 0)
+    {
+        fprintf(stderr, "read() %s from client %d.\n", conn->rbuf_size > 0 ? "unexpected EOF" : "EOF", conn->fd);
+        std::string log_message = "read() " + std::string(conn->rbuf_size > 0 ? "unexpected EOF" : "EOF") + " from client " + std::to_string(conn->fd) + ".\n";
+        format_asynclog_write(__FILE__, __func__, __LINE__ - 3, log_message.c_str(), AsyncLog::LogLevel::WARN);
+        conn->state = STATE_END;
+    }
+    else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED && conn->state != STATE_END)
+    {
+        errno = -cqe.res;
+        fprintf(stderr, "read() error.\n");
+        format_asynclog_write(__FILE__, __func__, __LINE__ - 3, "recv() error: ", AsyncLog::LogLevel::ERROR);
+        conn->state = STATE_END;
+    }
+}
+
+void uring_on_send(std::unique_ptr<ConnectionNode>& conn, const struct io_uring_cqe& cqe)
+{
+    --conn->sends_inflight;
+    if (cqe.res >= 0)
+    {
+        if (conn->state != STATE_END) { advance_wbufs(conn, static_cast<size_t>(cqe.res)); }
+        return;
+    }
+    if (cqe.res != -ECANCELED && conn->state != STATE_END)
+    {
+        errno = -cqe.res;
+        fprintf(stderr, "write() error.\n");
+        format_asynclog_write(__FILE__, __func__, __LINE__ - 3, "send() error: ", AsyncLog::LogLevel::ERROR);
+        conn->state = STATE_END;
+    }
+}
+
+// Same state machine as the epoll loop: requests are executed only in
+// STATE_REQ, responses are sent in STATE_RES, and further input is merely
+// buffered (up to URING_RBUF_BACKLOG) until the responses have gone out.
+void uring_service(IoUring& ring, std::vector<std::unique_ptr<ConnectionNode>>& fd_to_connection, int fd)
+{
+    auto& conn = fd_to_connection[fd];
+    if (conn->state == STATE_RES && conn->sends_inflight == 0 && conn->wbufs.empty())
+    {
+        conn->state = STATE_REQ;
+        conn->wbuf_sent = 0;
+    }
+    if (conn->state == STATE_REQ && conn->rbuf_size > 0) { drain_requests(conn); }
+    if (conn->state == STATE_RES && conn->sends_inflight == 0) { uring_queue_sends(ring, conn); }
+    if (conn->state == STATE_END)
+    {
+        if (conn->recv_armed || conn->sends_inflight > 0)
+        {
+            shutdown(conn->fd, SHUT_RDWR);
+            return;
         }
+        close(conn->fd);
+        fd_to_connection[fd].reset(nullptr);
+        return;
+    }
+    if (conn->recv_armed && !conn->recv_paused && conn->state == STATE_RES && conn->rbuf_size > URING_RBUF_BACKLOG)
+    {
+        uring_cancel_recv(ring, conn);
     }
+    if (!conn->recv_armed && (conn->state == STATE_REQ || conn->rbuf_size <= URING_RBUF_BACKLOG))
+    {
+        conn->recv_paused = false;
+        uring_arm_recv(ring, conn);
+    }
+}
+
+bool run_uring_loop(const char* port)
+{
+    IoUring ring;
+    if (!ring.init(URING_ENTRIES) || !ring.setup_buf_ring(URING_BUF_GROUP, URING_BUF_COUNT, URING_BUF_SIZE))
+    {
+        fprintf(stderr, "io_uring is unavailable, falling back to epoll.\n");
+        format_asynclog_write(__FILE__, __func__, __LINE__ - 3, "io_uring is unavailable, falling back to epoll.\n", AsyncLog::LogLevel::WARN);
+        return false;
+    }
+    int fd = Open_listenfd(port);
+    std::vector<std::unique_ptr<ConnectionNode>> fd_to_connection;
+    std::vector<int> touched;
+
+    uring_arm_accept(ring, fd);
+    bool rehash_pending = false;
+    while (true)
+    {
+        int ret = ring.submit_and_wait(1, rehash_pending ? REHASH_TIMEOUT_VAL : TIMEOUT_VAL);
+        if (ret < 0 && ret != -ETIME && ret != -EBUSY)
+        {
+            errno = -ret;
+            fprintf(stderr, "KV storage failed, please check the backend logs.\n");
+            format_asynclog_write(__FILE__, __func__, __LINE__ - 3, "io_uring_enter() error: ", AsyncLog::LogLevel::ERROR);
+            exit(EXIT_FAILURE);
+        }
+        touched.clear();
+        unsigned events = ring.for_each_cqe([&](const struct io_uring_cqe& cqe) {
+            uint32_t op = static_cast<uint32_t>(cqe.user_data >> 32);
+            int cfd = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+            if (op == URING_ACCEPT)
+            {
+                if (cqe.res >= 0)
+                {
+                    register_connection(fd_to_connection, cqe.res);
+                    touched.push_back(cqe.res);
+                }
+                if (!(cqe.flags & IORING_CQE_F_MORE)) { uring_arm_accept(ring, fd); }
+                return;
+            }
+            if (op == URING_CANCEL || static_cast<size_t>(cfd) >= fd_to_connection.size() || !fd_to_connection[cfd]) { return; }
+            if (op == URING_RECV) { uring_on_recv(ring, fd_to_connection[cfd], cqe); }
+            else { uring_on_send(fd_to_connection[cfd], cqe); }
+            touched.push_back(cfd);
+        });
+        if (events == 0)
+        {
+            rehash_pending = KvStroageData::Instance().rehash_idle(REHASH_IDLE_US);
+            continue;
+        }
+        ring.publish_bufs();
+        for (int cfd : touched)
+        {
+            if (fd_to_connection[cfd]) { uring_service(ring, fd_to_connection, cfd); }
+        }
+    }
+    close(fd);
+    return true;
 }
@@ -4,10 +4,15 @@
 #include <iostream>
 #include <fstream>
 #include <mutex>
+#include <shared_mutex>
+#include <thread>
 #include <random>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
+#include <chrono>
+#include <charconv>
 #include <unordered_map>
 #include <cstdio>
 #include <cerrno>
@@ -24,183 +29,203 @@
 #include <sys/epoll.h>
 #include <netinet/ip.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
+#include "kv_buffer.h"
+#include "kv_command.h"
+#include "kv_dict.h"
+#include "kv_skiplist.h"
+#include "kv_uring.h"
 #include "../utils/asynclog.h"
 #include "../utils/kv_constant.h"
 
+struct ServerConfig
+{
+    static ServerConfig& Instance()
+    {
+        static ServerConfig instance;
+        return instance;
+    }
+
+    int event_loops = DEFAULT_EVENT_LOOPS;
+    size_t max_request = DEFAULT_MAX_REQUEST;
+    bool use_uring = false;
+};
+
+// readable/writable mirror the edge-triggered epoll readiness of fd: set by
+// events, cleared only when read()/writev() returns EAGAIN.
 struct ConnectionNode
 {
     int fd = -1;
     uint32_t state = 0;
+    bool readable = false;
+    bool writable = true;
     size_t rbuf_size = 0;
-    uint8_t rbuf[4 + MAX_MSG] = {};
-    size_t wbuf_size = 0;
+    std::string rbuf;
     size_t wbuf_sent = 0;
-    uint8_t wbuf[4 + MAX_MSG] = {};
+    std::vector<std::string> wbufs;
+    // io_uring backend: multishot recv outstanding / cancelled for backlog,
+    // and sends submitted but not yet completed.
+    bool recv_armed = false;
+    bool recv_paused = false;
+    uint32_t sends_inflight = 0;
 };
 
-class Node
+/*
+ * Request arguments as views into the connection's read buffer. The first
+ * INLINE_ARGS views live inline so ordinary commands parse without touching
+ * the heap; the views are only valid until the request has been executed.
+ */
+class CmdArgs
 {
 public:
-    Node() {}
+    static constexpr size_t INLINE_ARGS = 8;
 
-    Node(const int64_t& _key, const std::string& _value, const int level) : key(_key), value(_value)
-    {
-        node_ptr_list.resize(level + 1);
-    }
+    size_t size() const { return argc; }
 
-    ~Node() {}
+    const std::string_view& operator[](size_t i) const { return argc > INLINE_ARGS ? spill[i] : inline_args[i]; }
 
-    int64_t get_key() const { return key; }
+    void push_back(std::string_view arg)
+    {
+        if (argc == INLINE_ARGS) { spill.assign(inline_args, inline_args + INLINE_ARGS); }
+        if (argc >= INLINE_ARGS) { spill.push_back(arg); }
+        else { inline_args[argc] = arg; }
+        ++argc;
+    }
 
-    std::string get_value() const { return value; }
+private:
+    std::string_view inline_args[INLINE_ARGS];
+    std::vector<std::string_view> spill;
+    size_t argc = 0;
+};
 
-    void set_value(const std::string _value) { value = _value; }
+struct ZSet
+{
+    KvDict<int64_t> members;
+    SkipList zlist;
+};
 
-    std::vector<std::shared_ptr<Node>> node_ptr_list;
+struct alignas(64) KvShard
+{
+    std::shared_mutex rwlock;
+    KvDict<std::string> hstrhash;
+    KvDict<std::unique_ptr<ZSet>> zsets;
+    size_t zmembers = 0;
 
-private:
-    int64_t key;
-    std::string value;
+    ZSet* zset_find(std::string_view key)
+    {
+        auto zset = zsets.find(key);
+        return zset ? zset->get() : nullptr;
+    }
 };
 
-class SkipList
+class KvStroageData
 {
 public:
-    SkipList(int _max_level = 18) : max_level(_max_level), skiplist_level(0), element_count(0)
+    static KvStroageData& Instance()
     {
-        header = std::make_shared<Node>(int64_t(), std::string(), max_level);
+        static KvStroageData instance;
+        return instance;
     }
 
-    ~SkipList() {}
+    ~KvStroageData() {}
 
-    int get_random_level()
+    static size_t shard_index(std::string_view key)
     {
-        int cur_level = 0;
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::bernoulli_distribution distrib(0.25);
-
-        while (distrib(gen))
-        {
-            ++cur_level;
-        }
-        return std::min(cur_level, max_level);
+        return KvDict<std::string>::hash_key(key) >> (sizeof(size_t) * 8 - KV_SHARD_BITS);
     }
 
-    std::shared_ptr<Node> create_node(const int64_t& _key, const std::string& _value, const int _level)
-    {
-        return std::make_shared<Node>(_key, _value, _level);
-    }
+    KvShard& shard_ref(std::string_view key) { return shards[shard_index(key)]; }
 
-    bool insert(const int64_t& _key, const std::string& _value)
-    {
-        std::shared_ptr<Node> cur = header;
-        std::vector<std::shared_ptr<Node>> update(max_level + 1);
+    KvShard& shard_at(size_t idx) { return shards[idx]; }
 
-        for (int i = skiplist_level; i >= 0; --i)
-        {
-            while (cur->node_ptr_list[i] != nullptr && cur->node_ptr_list[i]->get_key() < _key) { cur = cur->node_ptr_list[i]; }
-            update[i] = cur;
-        }
-        cur = cur->node_ptr_list[0];
-        if (cur == nullptr || cur->get_key() != _key)
+    size_t hsize()
+    {
+        size_t total = 0;
+        for (auto& shard : shards)
         {
-            int random_level = get_random_level();
-            if (skiplist_level < random_level)
-            {
-                for (int i = skiplist_level + 1; i <= random_level; ++i) { update[i] = header; }
-                skiplist_level = random_level;
-            }
-            auto new_node = create_node(_key, _value, random_level);
-            for (int i = 0; i <= random_level; ++i)
-            {
-                new_node->node_ptr_list[i] = update[i]->node_ptr_list[i];
-                update[i]->node_ptr_list[i] = new_node;
-            }
-            ++element_count;
-            return true;
+            std::shared_lock<std::shared_mutex> lk(shard.rwlock);
+            total += shard.hstrhash.size();
         }
-        return false;
+        return total;
     }
 
-    bool search(const int64_t& _key)
+    size_t zkeys()
     {
-        std::shared_ptr<Node> cur = header;
-
-        for (int i = skiplist_level; i >= 0; --i)
+        size_t total = 0;
+        for (auto& shard : shards)
         {
-            while (cur->node_ptr_list[i] != nullptr && cur->node_ptr_list[i]->get_key() < _key) { cur = cur->node_ptr_list[i]; }
+            std::shared_lock<std::shared_mutex> lk(shard.rwlock);
+            total += shard.zsets.size();
         }
-        cur = cur->node_ptr_list[0];
-        return cur != nullptr && cur->get_key() == _key;
+        return total;
     }
 
-    bool cancel(const int64_t& _key)
+    size_t zsize()
     {
-        std::shared_ptr<Node> cur = header;
-        std::vector<std::shared_ptr<Node>> update(max_level + 1);
-
-        for (int i = skiplist_level; i >= 0; --i)
+        size_t total = 0;
+        for (auto& shard : shards)
         {
-            while (cur->node_ptr_list[i] != nullptr && cur->node_ptr_list[i]->get_key() < _key) { cur = cur->node_ptr_list[i]; }
-            update[i] = cur;
+            std::shared_lock<std::shared_mutex> lk(shard.rwlock);
+            total += shard.zmembers;
         }
-        cur = cur->node_ptr_list[0];
-        if (cur != nullptr && cur->get_key() == _key)
+        return total;
+    }
+
+    bool rehash_idle(int64_t budget_us)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(budget_us);
+        auto out_of_time = [&](auto& dict) {
+            while (dict.rehash_step(REHASH_IDLE_GROUPS))
+            {
+                if (std::chrono::steady_clock::now() >= deadline) { return true; }
+            }
+            return false;
+        };
+        bool pending = false;
+        for (auto& shard : shards)
         {
-            for (int i = 0; i <= skiplist_level; ++i)
+            std::unique_lock<std::shared_mutex> lk(shard.rwlock, std::try_to_lock);
+            if (!lk.owns_lock())
             {
-                if (update[i]->node_ptr_list[i] != cur) { break; }
-                update[i]->node_ptr_list[i] = cur->node_ptr_list[i];
+                pending = true;
+                continue;
             }
-            while (skiplist_level > 0 && header->node_ptr_list[skiplist_level] == nullptr) { --skiplist_level; }
-            --element_count;
-            return true;
+            if (out_of_time(shard.hstrhash) || out_of_time(shard.zsets)) { return true; }
         }
-        return false;
+        return pending;
     }
 
-    int size() { return element_count; }
-
-private:
-    int max_level;
-    int skiplist_level;
-    int element_count;
-    std::shared_ptr<Node> header;
-};
-
-class KvStroageData
-{
-public:
-    static KvStroageData& Instance()
+    void rehash_stats(size_t& dicts, size_t& moved, size_t& total)
     {
-        static KvStroageData instance;
-        return instance;
+        dicts = moved = total = 0;
+        auto collect = [&](auto& dict) {
+            if (!dict.rehashing()) { return; }
+            ++dicts;
+            moved += dict.rehash_moved_groups();
+            total += dict.rehash_total_groups();
+        };
+        for (auto& shard : shards)
+        {
+            std::shared_lock<std::shared_mutex> lk(shard.rwlock);
+            collect(shard.hstrhash);
+            collect(shard.zsets);
+        }
     }
 
-    ~KvStroageData() {}
-
-    size_t hsize() { return hstrhash.size(); }
-    size_t zsize() { return zsethash.size(); }
-
     std::vector<std::string> get_all_keys()
     {
         std::vector<std::string> keys;
-        for (auto& x : hstrhash) { keys.emplace_back(x.first); }
-        for (auto& x : zsethash) { keys.emplace_back(x.first); }
+        for (auto& shard : shards)
+        {
+            std::shared_lock<std::shared_mutex> lk(shard.rwlock);
+            shard.hstrhash.for_each([&keys](const std::string& key, std::string&) { keys.emplace_back(key); });
+            shard.zsets.for_each([&keys](const std::string& key, std::unique_ptr<ZSet>&) { keys.emplace_back(key); });
+        }
         return keys;
     }
 
-    std::unordered_map<std::string, std::string>& hstrhash_ref() { return hstrhash; }
-
-    std::unordered_map<std::string, int64_t>& hzset_ref() { return zsethash; }
-
-    SkipList& hzlist_ref() { return zsetlist; }
-
 private:
-    std::unordered_map<std::string, std::string> hstrhash;
-    SkipList zsetlist;
-    std::unordered_map<std::string, int64_t> zsethash;
+    KvShard shards[KV_SHARD_NUM];
 
     KvStroageData() {}
     KvStroageData(const KvStroageData&) = delete;
@@ -209,6 +234,8 @@ private:
 
 void signal_handler(int signum);
 
+bool parse_config(int argc, char* argv[]);
+
 void format_asynclog_write(const char* file_name, const char* func_name, int cur_line, const char* log_mes, AsyncLog::LogLevel level);
 
 int Epoll_create1(int flags);
@@ -227,44 +254,68 @@ void fd_set_nb(int fd);
 
 void out_nil(std::string& out);
 
-void out_str(std::string& out, const std::string& val);
+void out_str(std::string& out, std::string_view val);
 
 void out_int(std::string& out, int64_t val);
 
-void out_err(std::string& out, int32_t code, const std::string& msg);
+void out_err(std::string& out, int32_t code, std::string_view msg);
 
 void out_arr(std::string& out, uint32_t n);
 
-int parse_request(const uint8_t* buf, size_t len, std::vector<std::string>& out);
+int parse_request(const uint8_t* buf, size_t len, CmdArgs& out);
 
 int accept_new_connection(std::vector<std::unique_ptr<ConnectionNode>>& fd_to_connection, int fd);
 
-bool judge_cmd(const std::string& word, const char* cmd);
+void register_connection(std::vector<std::unique_ptr<ConnectionNode>>& fd_to_connection, int connfd);
+
+bool judge_cmd(std::string_view word, const char* cmd);
 
-bool str_to_int(const std::string& s, int64_t& out);
+bool str_to_int(std::string_view s, int64_t& out);
 
-void do_keys(const std::vector<std::string>& cmd, std::string& out);
+bool str_to_score(std::string_view s, int64_t& out);
 
-void do_get(const std::vector<std::string>& cmd, std::string& out);
+void do_keys(const CmdArgs& cmd, std::string& out);
 
-void do_set(const std::vector<std::string>& cmd, std::string& out);
+void do_get(const CmdArgs& cmd, std::string& out);
 
-void do_del(const std::vector<std::string>& cmd, std::string& out);
+void do_set(const CmdArgs& cmd, std::string& out);
 
-void do_zadd(const std::vector<std::string>& cmd, std::string& out);
+void do_del(const CmdArgs& cmd, std::string& out);
 
-void do_zrem(const std::vector<std::string>& cmd, std::string& out);
+void do_zadd(const CmdArgs& cmd, std::string& out);
 
-void do_zscore(const std::vector<std::string>& cmd, std::string& out);
+void do_zrem(const CmdArgs& cmd, std::string& out);
 
-void do_zcard(const std::vector<std::string>& cmd, std::string& out);
+void do_zscore(const CmdArgs& cmd, std::string& out);
 
-void do_request(std::vector<std::string>& cmd, std::string& out);
+void do_zcard(const CmdArgs& cmd, std::string& out);
 
-bool try_one_request(std::unique_ptr<ConnectionNode>& conn);
+void do_zrank(const CmdArgs& cmd, std::string& out);
+
+void out_zrange(std::string& out, const ZSet* zset, size_t first_rank, size_t count);
+
+void do_zrange(const CmdArgs& cmd, std::string& out);
+
+void do_zrangebyscore(const CmdArgs& cmd, std::string& out);
+
+void do_zcount(const CmdArgs& cmd, std::string& out);
+
+void do_info(const CmdArgs& cmd, std::string& out);
+
+const KvCommand* lookup_command(std::string_view name);
+
+void do_request(const CmdArgs& cmd, std::string& out);
+
+bool try_one_request(std::unique_ptr<ConnectionNode>& conn, size_t& consumed);
+
+void drain_requests(std::unique_ptr<ConnectionNode>& conn);
+
+void reserve_rbuf(std::unique_ptr<ConnectionNode>& conn, size_t want);
 
 bool try_fill_buffer(std::unique_ptr<ConnectionNode>& conn);
 
+void advance_wbufs(std::unique_ptr<ConnectionNode>& conn, size_t bytes_written);
+
 bool try_flush_buffer(std::unique_ptr<ConnectionNode>& conn);
 
 void state_req(std::unique_ptr<ConnectionNode>& conn);
@@ -273,4 +324,24 @@ void state_res(std::unique_ptr<ConnectionNode>& conn);
 
 void connection_io(std::unique_ptr<ConnectionNode>& conn);
 
+void run_event_loop(const char* port);
+
+uint64_t uring_tag(uint32_t op, int fd);
+
+void uring_arm_accept(IoUring& ring, int listenfd);
+
+void uring_arm_recv(IoUring& ring, std::unique_ptr<ConnectionNode>& conn);
+
+void uring_cancel_recv(IoUring& ring, std::unique_ptr<ConnectionNode>& conn);
+
+void uring_queue_sends(IoUring& ring, std::unique_ptr<ConnectionNode>& conn);
+
+void uring_on_recv(IoUring& ring, std::unique_ptr<ConnectionNode>& conn, const struct io_uring_cqe& cqe);
+
+void uring_on_send(std::unique_ptr<ConnectionNode>& conn, const struct io_uring_cqe& cqe);
+
+void uring_service(IoUring& ring, std::vector<std::unique_ptr<ConnectionNode>>& fd_to_connection, int fd);
+
+bool run_uring_loop(const char* port);
+
 #endif
@@ -2,14 +2,35 @@
 #define KV_CONSTANT_H
 
 #include <cstdint>
-constexpr int TIMEOUT_VAL = 5000;
-constexpr size_t MAX_MSG = 4096;
+constexpr int TIMEOUT_VAL = 100;
+constexpr int REHASH_TIMEOUT_VAL = 1;
+constexpr int64_t REHASH_IDLE_US = 1000;
+constexpr size_t REHASH_IDLE_GROUPS = 64;
+constexpr int DEFAULT_EVENT_LOOPS = 1;
+constexpr int MAX_EVENT_LOOPS = 256;
+constexpr size_t KV_SHARD_BITS = 6;
+constexpr size_t KV_SHARD_NUM = size_t(1) << KV_SHARD_BITS;
+constexpr size_t BUF_MIN_SIZE = 4096;
+constexpr size_t WBUF_CHUNK_SIZE = 16 * 1024;
+constexpr int IOV_BATCH = 64;
+constexpr size_t DEFAULT_MAX_REQUEST = 64 * 1024 * 1024;
+constexpr size_t MAX_RESPONSE = 512 * 1024 * 1024;
 constexpr size_t MAX_ARGS = 1024;
+constexpr unsigned URING_ENTRIES = 1024;
+constexpr unsigned URING_BUF_COUNT = 512;
+constexpr unsigned URING_BUF_SIZE = 4096;
+constexpr uint16_t URING_BUF_GROUP = 0;
+constexpr size_t URING_RBUF_BACKLOG = 1024 * 1024;
 
 constexpr uint32_t STATE_REQ = 0;
 constexpr uint32_t STATE_RES = 1;
 constexpr uint32_t STATE_END = 2;
 
+constexpr uint32_t URING_ACCEPT = 0;
+constexpr uint32_t URING_RECV = 1;
+constexpr uint32_t URING_SEND = 2;
+constexpr uint32_t URING_CANCEL = 3;
+
 constexpr char SERIAL_NIL = '0';
 constexpr char SERIAL_ERR = '1';
 constexpr char SERIAL_STR = '2';